@@ -0,0 +1,334 @@
+// Position drift benchmark
+//
+// Drives the Shutter class against a simulated physical shutter under a virtual clock and reports how far the
+// estimated position is from the real one after a series of random set_position() calls.
+//
+// Build and run with `make bench`, parameters can be passed as key=value arguments, e.g.:
+//
+//   bench/build/drift moves=100 trials=500 seed=7 stop_lag=300
+//
+// The Remote is replaced by a stub which delivers each command after a random delay.  Queueing, STOP priority and idle
+// cursor navigation of the real Remote are not modelled, so their effect on the drift is not measured here.
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <PicoSyslog.h>
+
+#include "shutter.h"
+
+PicoSyslog::Logger syslog;
+Remote remote;
+
+namespace {
+
+unsigned long now_ms = 0;
+
+// simulation time step
+const unsigned long STEP_MS = 10;
+
+struct Parameters {
+    unsigned long moves = 50;
+    unsigned long trials = 200;
+    unsigned long seed = 1;
+
+    // times configured for the Shutter
+    unsigned long open_time = 30000;
+    unsigned long close_time = 25000;
+
+    // relative error of the configured times compared to the real ones
+    double open_time_error = 0.01;
+    double close_time_error = -0.01;
+
+    // motor reaction time after a command is received
+    unsigned long start_lag = 300;
+    unsigned long stop_lag = 200;
+
+    // time from Remote::execute() to the radio command, uniformly distributed
+    unsigned long press_min = 400;
+    unsigned long press_max = 700;
+
+    // time between moves
+    unsigned long idle = 2000;
+};
+
+std::mt19937 rng;
+
+unsigned long uniform(unsigned long min, unsigned long max) {
+    return std::uniform_int_distribution<unsigned long>(min, max)(rng);
+}
+
+// The real thing: travels at a constant speed, reacts to commands with a delay and stops at the end stops.
+class PhysicalShutter {
+    public:
+        PhysicalShutter(const Parameters & p)
+            : open_time(p.open_time * (1 + p.open_time_error)), close_time(p.close_time * (1 + p.close_time_error)),
+              start_lag(p.start_lag), stop_lag(p.stop_lag) {}
+
+        void command(command_t command) {
+            const int new_direction = command == COMMAND_UP ? 1 : command == COMMAND_DOWN ? -1 : 0;
+            unsigned long time = now_ms;
+            if (direction != 0) {
+                time += stop_lag;
+                events.push_back({time, 0});
+            }
+            if (new_direction != 0) {
+                time += start_lag;
+                events.push_back({time, new_direction});
+            }
+        }
+
+        void update() {
+            while (!events.empty() && (events.front().time <= now_ms)) {
+                direction = events.front().direction;
+                events.pop_front();
+            }
+
+            if (direction > 0) {
+                position += 100.0 * STEP_MS / open_time;
+            } else if (direction < 0) {
+                position -= 100.0 * STEP_MS / close_time;
+            }
+
+            if ((position >= 100) || (position <= 0)) {
+                position = std::max(0.0, std::min(100.0, position));
+                direction = 0;
+            }
+        }
+
+        bool idle() const { return events.empty() && (direction == 0); }
+
+        double position = 0;
+
+    protected:
+        struct Event {
+            unsigned long time;
+            int direction;
+        };
+
+        const double open_time, close_time;
+        const unsigned long start_lag, stop_lag;
+        int direction = 0;
+        std::deque<Event> events;
+};
+
+// Commands queued with Remote::execute(), sent to the physical shutter after a random delay.
+struct Press {
+    unsigned long time;
+    unsigned int index;
+    command_t command;
+};
+
+std::deque<Press> presses;
+const Parameters * parameters;
+PhysicalShutter * physical;
+unsigned long press_count;
+
+void deliver() {
+    while (!presses.empty() && (presses.front().time <= now_ms)) {
+        const auto press = presses.front();
+        presses.pop_front();
+        ++press_count;
+        physical->command(press.command);
+        remote.on_execute(press.index, press.command);
+    }
+}
+
+struct Sample {
+    double error;
+    double uncertainty;
+};
+
+struct Result {
+    std::vector<Sample> final_samples;
+    std::vector<Sample> all_samples;
+    unsigned long resyncs = 0;
+    unsigned long presses = 0;
+    unsigned long timeouts = 0;
+};
+
+void run_trial(const Parameters & p, Result & result) {
+    PhysicalShutter shutter_model(p);
+    physical = &shutter_model;
+    presses.clear();
+    press_count = 0;
+
+    Shutter shutter(1, p.open_time, p.close_time);
+    remote.on_execute = [&shutter](unsigned int, command_t command) { shutter.on_execute(command); };
+
+    const auto settle = [&] {
+        const unsigned long deadline = now_ms + 10 * 60 * 1000;
+        while (now_ms < deadline) {
+            now_ms += STEP_MS;
+            shutter.tick();
+            deliver();
+            shutter_model.update();
+            if (presses.empty() && shutter_model.idle() && !shutter.positioning()
+                    && (shutter.get_state() == COMMAND_STOP)) {
+                return;
+            }
+        }
+        ++result.timeouts;
+    };
+
+    // start from a known position, like after a sync
+    shutter_model.position = uniform(0, 100);
+    shutter.set_position(0);
+    settle();
+
+    for (unsigned long move = 0; move < p.moves; ++move) {
+        now_ms += p.idle;
+        shutter.set_position(uniform(1, 99));
+        if (std::isnan(shutter.get_position())) {
+            // Shutter decided to resync through an end stop
+            ++result.resyncs;
+        }
+        settle();
+
+        const Sample sample{shutter.get_position() - shutter_model.position, shutter.get_uncertainty()};
+        result.all_samples.push_back(sample);
+        if (move + 1 == p.moves) {
+            result.final_samples.push_back(sample);
+        }
+    }
+
+    result.presses += press_count;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    std::sort(values.begin(), values.end());
+    const size_t index = std::min(values.size() - 1, size_t(p / 100.0 * values.size()));
+    return values[index];
+}
+
+void report(const char * name, const std::vector<Sample> & samples) {
+    std::vector<double> errors;
+    std::vector<double> abs_errors;
+    unsigned long covered = 0;
+    for (const auto & sample : samples) {
+        errors.push_back(sample.error);
+        abs_errors.push_back(std::fabs(sample.error));
+        if (std::fabs(sample.error) <= sample.uncertainty) {
+            ++covered;
+        }
+    }
+
+    double mean = 0;
+    for (const auto & e : errors) {
+        mean += e;
+    }
+    mean /= errors.size();
+
+    printf("%-12s n=%-6zu bias=%+7.2f  |err| p50=%6.2f p90=%6.2f p99=%6.2f max=%6.2f  within uncertainty=%5.1f%%\n",
+           name, samples.size(), mean,
+           percentile(abs_errors, 50), percentile(abs_errors, 90), percentile(abs_errors, 99),
+           percentile(abs_errors, 100), 100.0 * covered / samples.size());
+}
+
+bool parse(Parameters & p, const char * arg) {
+    const char * eq = strchr(arg, '=');
+    if (!eq) {
+        return false;
+    }
+
+    const std::string key(arg, eq);
+    const char * value = eq + 1;
+
+    const std::map<std::string, unsigned long *> integers = {
+        {"moves", &p.moves}, {"trials", &p.trials}, {"seed", &p.seed},
+        {"open_time", &p.open_time}, {"close_time", &p.close_time},
+        {"start_lag", &p.start_lag}, {"stop_lag", &p.stop_lag},
+        {"press_min", &p.press_min}, {"press_max", &p.press_max}, {"idle", &p.idle},
+    };
+    const std::map<std::string, double *> reals = {
+        {"open_time_error", &p.open_time_error}, {"close_time_error", &p.close_time_error},
+    };
+
+    if (integers.count(key)) {
+        *integers.at(key) = strtoul(value, nullptr, 10);
+    } else if (reals.count(key)) {
+        *reals.at(key) = strtod(value, nullptr);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char * validate(const Parameters & p) {
+    if (!p.moves || !p.trials) {
+        return "moves and trials must be positive";
+    }
+    if (!p.open_time || !p.close_time) {
+        return "open_time and close_time must be positive";
+    }
+    if ((p.open_time_error <= -1) || (p.close_time_error <= -1)) {
+        return "open_time_error and close_time_error must be greater than -1";
+    }
+    if (p.press_min > p.press_max) {
+        return "press_min must not be greater than press_max";
+    }
+    return nullptr;
+}
+
+}
+
+unsigned long millis() {
+    return now_ms;
+}
+
+void Remote::execute(unsigned int index, const command_t command) {
+    presses.push_back({now_ms + uniform(parameters->press_min, parameters->press_max), index, command});
+}
+
+bool Remote::pending(unsigned int index) const {
+    for (const auto & press : presses) {
+        if (press.index == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char * argv[]) {
+    Parameters p;
+    for (int i = 1; i < argc; ++i) {
+        if (!parse(p, argv[i])) {
+            fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    const char * error = validate(p);
+    if (error) {
+        fprintf(stderr, "Invalid parameters: %s\n", error);
+        return 1;
+    }
+
+    parameters = &p;
+    rng.seed(p.seed);
+
+    printf("moves=%lu trials=%lu seed=%lu open_time=%lu close_time=%lu open_time_error=%g close_time_error=%g "
+           "start_lag=%lu stop_lag=%lu press_min=%lu press_max=%lu idle=%lu\n",
+           p.moves, p.trials, p.seed, p.open_time, p.close_time, p.open_time_error, p.close_time_error,
+           p.start_lag, p.stop_lag, p.press_min, p.press_max, p.idle);
+
+    Result result;
+    for (unsigned long trial = 0; trial < p.trials; ++trial) {
+        run_trial(p, result);
+    }
+
+    report("final", result.final_samples);
+    report("all moves", result.all_samples);
+    printf("resyncs per trial=%.2f  presses per move=%.2f  timeouts=%lu\n",
+           double(result.resyncs) / p.trials, double(result.presses) / (p.trials * p.moves), result.timeouts);
+
+    return result.timeouts ? 2 : 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Minimal stand-in for the Arduino core, just enough to build the Shutter class on the host.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+// virtual clock, provided by the benchmark
+unsigned long millis();
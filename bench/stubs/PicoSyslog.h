@@ -0,0 +1,13 @@
+#pragma once
+
+namespace PicoSyslog {
+
+// discards all messages
+class Logger {
+    public:
+        template <typename... Args>
+        void printf(const char *, Args...) {}
+        void println(const char *) {}
+};
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace PicoUtils {
+
+class Stopwatch {
+    public:
+        Stopwatch(): start(millis()) {}
+        void reset() { start = millis(); }
+        unsigned long elapsed_millis() const { return millis() - start; }
+
+    protected:
+        unsigned long start;
+};
+
+// value with the time of its last assignment
+template <typename T>
+class TimedValue {
+    public:
+        TimedValue(const T & value): value(value) {}
+
+        TimedValue & operator=(const T & new_value) {
+            value = new_value;
+            stopwatch.reset();
+            return *this;
+        }
+
+        operator T() const { return value; }
+        unsigned long elapsed_millis() const { return stopwatch.elapsed_millis(); }
+
+    protected:
+        T value;
+        Stopwatch stopwatch;
+};
+
+}
@@ -0,0 +1,373 @@
+#include <Arduino.h>
+
+#include <functional>
+
+#include <PicoMQTT.h>
+#include <PicoSyslog.h>
+
+#include "config.h"
+#include "watchdog.h"
+
+extern PicoMQTT::Client mqtt;
+extern PicoSyslog::Logger syslog;
+extern String hostname;
+extern String hass_autodiscovery_topic;
+extern String password;
+
+namespace {
+
+// Configuration files are parsed one top level entry at a time, so the memory needed to load them doesn't depend on
+// the number of entries.  These limit the size of a single entry.
+const size_t MAX_KEY_SIZE = 64;
+const size_t MAX_VALUE_SIZE = 512;
+
+// limit on the number of items in each list of a report
+const size_t MAX_REPORT_ITEMS = 16;
+
+using EntryCallback = std::function<void(const char * key, JsonVariantConst value)>;
+
+class EntryReader {
+    public:
+        EntryReader(Stream & stream, Config::Report & report): stream(stream), report(report) {}
+
+        // Call callback for each entry of the top level JSON object
+        bool read(const EntryCallback & callback) {
+            next();
+            skip_whitespace();
+            if (c != '{') {
+                return fail("expected an object");
+            }
+
+            next();
+            skip_whitespace();
+            if (c == '}') {
+                return true;
+            }
+
+            JsonDocument doc;
+
+            while (true) {
+                char key[MAX_KEY_SIZE];
+                char value[MAX_VALUE_SIZE];
+                size_t value_length;
+
+                if (!read_key(key, doc) || !read_value(value, value_length)) {
+                    return false;
+                }
+
+                ++report.entries;
+
+                if (value_length > MAX_VALUE_SIZE) {
+                    report.add(report.invalid_entries, String(key) + ": entry too large");
+                } else {
+                    const auto error = deserializeJson(doc, (const char *) value, value_length,
+                                                       DeserializationOption::NestingLimit(2));
+                    if (error) {
+                        report.add(report.invalid_entries, String(key) + ": " + error.c_str());
+                    } else {
+                        callback(key, doc.as<JsonVariantConst>());
+                    }
+                }
+
+                if (c == '}') {
+                    return true;
+                }
+
+                // c must be a comma at this point
+                next();
+                skip_whitespace();
+            }
+        }
+
+    protected:
+        void next() { c = stream.read(); }
+
+        void skip_whitespace() {
+            while ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r')) {
+                next();
+            }
+        }
+
+        bool fail(const char * message) {
+            report.error = message;
+            return false;
+        }
+
+        // Read a key into a buffer of MAX_KEY_SIZE bytes, escape sequences are decoded by ArduinoJson.
+        bool read_key(char * key, JsonDocument & doc) {
+            if (c != '"') {
+                return fail("expected a key");
+            }
+
+            // raw text of the key, including the quotes
+            char raw[MAX_KEY_SIZE + 2];
+            size_t length = 0;
+            bool escape = false;
+
+            raw[length++] = '"';
+            next();
+            while (escape || (c != '"')) {
+                if (c < 0) {
+                    return fail("unexpected end of file");
+                }
+                if (length >= MAX_KEY_SIZE) {
+                    return fail("key too long");
+                }
+                escape = !escape && (c == '\\');
+                raw[length++] = c;
+                next();
+            }
+            raw[length++] = '"';
+
+            if (deserializeJson(doc, (const char *) raw, length) || !doc.is<const char *>()) {
+                return fail("invalid key");
+            }
+            strlcpy(key, doc.as<const char *>(), MAX_KEY_SIZE);
+
+            next();
+            skip_whitespace();
+            if (c != ':') {
+                return fail("expected a colon");
+            }
+
+            next();
+            skip_whitespace();
+            return true;
+        }
+
+        // Read the raw text of a value up to the comma or brace which ends it.  If the value doesn't fit in the buffer,
+        // it's skipped and length is set to a value greater than MAX_VALUE_SIZE.
+        bool read_value(char * value, size_t & length) {
+            unsigned int depth = 0;
+            bool in_string = false;
+            bool escape = false;
+
+            length = 0;
+            while (true) {
+                if (c < 0) {
+                    return fail("unexpected end of file");
+                }
+
+                if (!in_string && (depth == 0) && ((c == ',') || (c == '}'))) {
+                    break;
+                }
+
+                if (in_string) {
+                    if (escape) {
+                        escape = false;
+                    } else if (c == '\\') {
+                        escape = true;
+                    } else if (c == '"') {
+                        in_string = false;
+                    }
+                } else if (c == '"') {
+                    in_string = true;
+                } else if ((c == '{') || (c == '[')) {
+                    ++depth;
+                } else if ((c == '}') || (c == ']')) {
+                    if (depth == 0) {
+                        return fail("unbalanced brackets");
+                    }
+                    --depth;
+                }
+
+                if (length < MAX_VALUE_SIZE) {
+                    value[length] = c;
+                }
+                ++length;
+                next();
+            }
+
+            if (length <= MAX_VALUE_SIZE) {
+                while ((length > 0) && isspace(value[length - 1])) {
+                    --length;
+                }
+            }
+
+            return true;
+        }
+
+        Stream & stream;
+        Config::Report & report;
+        int c;
+};
+
+bool load(FS & fs, const char * path, Config::Report & report, const EntryCallback & callback) {
+    report.clear();
+
+    const unsigned long start = millis();
+
+    File file = fs.open(path, "r");
+    if (!file) {
+        report.error = "cannot open file";
+    } else {
+        EntryReader(file, report).read(callback);
+        file.close();
+    }
+
+    report.parse_time_ms = millis() - start;
+
+    syslog.printf("Loaded %s in %lu ms: %u entries, %s.\n", path, report.parse_time_ms, report.entries,
+                  report.error.length() ? report.error.c_str() : "ok");
+    return report.error.isEmpty();
+}
+
+void check_keys(Config::Report & report, const char * prefix, JsonObjectConst object,
+                std::initializer_list<const char *> known) {
+    for (const auto & kv : object) {
+        bool found = false;
+        for (const char * name : known) {
+            if (strcmp(kv.key().c_str(), name) == 0) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            report.add(report.unknown_keys, String(prefix) + "." + kv.key().c_str());
+        }
+    }
+}
+
+}
+
+namespace Config {
+
+Report network_report;
+Report shutters_report;
+
+void Report::clear() {
+    error = "";
+    entries = 0;
+    parse_time_ms = 0;
+    truncated = false;
+    unknown_keys.clear();
+    duplicate_indices.clear();
+    dangling_members.clear();
+    invalid_entries.clear();
+}
+
+void Report::add(std::vector<String> & list, const String & item) {
+    if (list.size() >= MAX_REPORT_ITEMS) {
+        truncated = true;
+        return;
+    }
+    syslog.printf("Config problem: %s\n", item.c_str());
+    list.push_back(item);
+}
+
+void Report::to_json(JsonObject json) const {
+    if (error.length()) {
+        json["error"] = error;
+    }
+    json["entries"] = entries;
+    json["parse_time_ms"] = parse_time_ms;
+    json["truncated"] = truncated;
+
+    const auto add_list = [&json](const char * name, const std::vector<String> & list) {
+        auto array = json[name].to<JsonArray>();
+        for (const auto & item : list) {
+            array.add(item);
+        }
+    };
+
+    add_list("unknown_keys", unknown_keys);
+    add_list("duplicate_indices", duplicate_indices);
+    add_list("dangling_members", dangling_members);
+    add_list("invalid_entries", invalid_entries);
+}
+
+void load_network(FS & fs) {
+    hostname = "rolek";
+    hass_autodiscovery_topic = "homeassistant";
+    mqtt.host = "";
+    mqtt.port = 1883;
+    mqtt.username = "mqtt";
+    mqtt.password = "mosquitto";
+    password = "";
+    syslog.server = "";
+
+    load(fs, "/network.json", network_report, [](const char * key, JsonVariantConst value) {
+        if (strcmp(key, "hostname") == 0) {
+            hostname = value | "rolek";
+        } else if (strcmp(key, "hass_autodiscovery_topic") == 0) {
+            hass_autodiscovery_topic = value | "homeassistant";
+        } else if (strcmp(key, "mqtt") == 0) {
+            check_keys(network_report, key, value.as<JsonObjectConst>(), {"host", "port", "username", "password"});
+            mqtt.host = value["host"] | "";
+            mqtt.port = value["port"] | 1883;
+            mqtt.username = value["username"] | "mqtt";
+            mqtt.password = value["password"] | "mosquitto";
+        } else if (strcmp(key, "password") == 0) {
+            password = value | "";
+        } else if (strcmp(key, "syslog") == 0) {
+            syslog.server = value | "";
+        } else if (strcmp(key, "resync_threshold") == 0) {
+            Shutter::resync_threshold = value | Shutter::resync_threshold;
+        } else if (strcmp(key, "predictive_navigation") == 0) {
+            remote.predictive_navigation = value | true;
+        } else if (strcmp(key, "loop_budget_ms") == 0) {
+            Watchdog::budget_ms = value | Watchdog::budget_ms;
+        } else {
+            network_report.add(network_report.unknown_keys, key);
+        }
+    });
+}
+
+void load_shutters(FS & fs, std::map<String, Shutter> & shutters, std::map<String, std::vector<String>> & groups) {
+    Report & report = shutters_report;
+    std::map<unsigned int, String> indices;
+
+    const auto add_shutter = [&](const char * name, unsigned int index, double open_time, double close_time) {
+        if (!index) {
+            report.add(report.invalid_entries, String(name) + ": invalid index");
+            return;
+        }
+
+        if (!shutters.try_emplace(name, index, 1000 * open_time, 1000 * close_time).second) {
+            report.add(report.invalid_entries, String(name) + ": duplicate name");
+            return;
+        }
+
+        const auto inserted = indices.emplace(index, name);
+        if (!inserted.second) {
+            report.add(report.duplicate_indices, String(index) + ": " + inserted.first->second + ", " + name);
+        }
+    };
+
+    load(fs, "/shutters.json", report, [&](const char * key, JsonVariantConst value) {
+        if (value.is<unsigned int>()) {
+            add_shutter(key, value.as<unsigned int>(), 30, 30);
+        } else if (value.is<JsonObjectConst>()) {
+            check_keys(report, key, value.as<JsonObjectConst>(), {"index", "time", "open_time", "close_time"});
+            const unsigned int index = value["index"] | 0;
+            const double open_time = value["open_time"] | value["time"] | 30;
+            const double close_time = value["close_time"] | value["time"] | 30;
+            add_shutter(key, index, open_time, close_time);
+        } else if (value.is<JsonArrayConst>()) {
+            if (groups.count(key)) {
+                report.add(report.invalid_entries, String(key) + ": duplicate name");
+                return;
+            }
+            auto & group = groups[key];
+            for (const auto & element : value.as<JsonArrayConst>()) {
+                if (element.is<const char *>()) {
+                    group.push_back(element.as<const char *>());
+                } else {
+                    report.add(report.invalid_entries, String(key) + ": group members must be names");
+                }
+            }
+        } else {
+            report.add(report.invalid_entries, String(key) + ": unsupported value");
+        }
+    });
+
+    for (const auto & kv : groups) {
+        for (const auto & element : kv.second) {
+            if (!shutters.count(element) && !groups.count(element)) {
+                report.add(report.dangling_members, kv.first + ": " + element);
+            }
+        }
+    }
+}
+
+}
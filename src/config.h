@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+#include "shutter.h"
+
+namespace Config {
+
+// Problems found while loading a configuration file
+struct Report {
+    void clear();
+    void add(std::vector<String> & list, const String & item);
+    void to_json(JsonObject json) const;
+
+    String error;
+    unsigned int entries;
+    unsigned long parse_time_ms;
+    bool truncated;
+
+    std::vector<String> unknown_keys;
+    std::vector<String> duplicate_indices;
+    std::vector<String> dangling_members;
+    std::vector<String> invalid_entries;
+};
+
+extern Report network_report;
+extern Report shutters_report;
+
+void load_network(FS & fs);
+void load_shutters(FS & fs, std::map<String, Shutter> & shutters, std::map<String, std::vector<String>> & groups);
+
+}
@@ -1,6 +1,8 @@
 #include <Arduino.h>
 
+#include <algorithm>
 #include <map>
+#include <set>
 
 #include <ArduinoJson.h>
 #include <PicoMQTT.h>
@@ -9,6 +11,7 @@
 
 #include "hass.h"
 #include "shutter.h"
+#include "watchdog.h"
 
 extern PicoMQTT::Client mqtt;
 extern PicoSyslog::Logger syslog;
@@ -17,14 +20,20 @@ extern std::map<String, Shutter> shutters;
 extern String hostname;
 
 bool process(const String & name, const command_t command);
-bool sync();
+void sync(bool force);
+bool reload_shutters();
 
 namespace {
 
 const String board_id(ESP.getChipId(), HEX);
 
-std::list<PicoUtils::Watch<double>> position_watches;
-std::list<PicoUtils::Watch<command_t>> state_watches;
+std::map<String, PicoUtils::Watch<double>> position_watches;
+std::map<String, PicoUtils::Watch<command_t>> state_watches;
+
+bool autodiscovery_pending = false;
+
+// indices of shutters removed while MQTT was disconnected, their retained messages still need to be cleared
+std::set<unsigned int> pending_retractions;
 
 String get_first_word(const String & s) {
     auto space_idx = s.indexOf(' ');
@@ -68,6 +77,52 @@ void notify_position(const Shutter & shutter) {
         String(std::isnan(position) ? 50 : position), 0, true);
 }
 
+void announce(const String & name, const Shutter & shutter) {
+    if (hass_autodiscovery_topic.length() == 0) {
+        return;
+    }
+
+    const String board_unique_id = "rolek_" + board_id;
+    const auto unique_id = board_unique_id + "_" + String(shutter.index);
+    const String topic = hass_autodiscovery_topic + "/cover/" + unique_id + "/config";
+    String friendly_hostname = hostname;
+    friendly_hostname[0] = friendly_hostname[0] ^ ' ';
+
+    JsonDocument json;
+    json["unique_id"] = unique_id;
+    json["name"] = friendly_hostname + " " + name;
+    json["object_id"] = hostname + "_" + name;
+    json["command_topic"] = "rolek/" + board_id + "/" + String(shutter.index) + "/command";
+    json["state_topic"] = "rolek/" + board_id + "/" + String(shutter.index) + "/state";
+    json["position_topic"] = "rolek/" + board_id + "/" + String(shutter.index) + "/position";
+    json["set_position_topic"] = "rolek/" + board_id + "/" + String(shutter.index) + "/position/set";
+    json["availability_topic"] = "rolek/" + board_id + "/availability";
+    json["device_class"] = "shutter";
+
+    auto device = json["device"];
+    device["name"] = "Rolek controller " + name;
+    device["suggested_area"] = get_first_word(name);
+    device["identifiers"][0] = unique_id;
+    device["via_device"] = board_unique_id;
+
+    auto publish = mqtt.begin_publish(topic, measureJson(json), 0, true);
+    serializeJson(json, publish);
+    publish.send();
+}
+
+void retract(unsigned int index) {
+    const String prefix = "rolek/" + board_id + "/" + String(index);
+    mqtt.publish(prefix + "/state", "", 0, true);
+    mqtt.publish(prefix + "/position", "", 0, true);
+
+    if (hass_autodiscovery_topic.length() == 0) {
+        return;
+    }
+
+    const String unique_id = "rolek_" + board_id + "_" + String(index);
+    mqtt.publish(hass_autodiscovery_topic + "/cover/" + unique_id + "/config", "", 0, true);
+}
+
 void autodiscover() {
     if (hass_autodiscovery_topic.length() == 0) {
         syslog.println("Home Assistant autodiscovery disabled.");
@@ -78,33 +133,10 @@ void autodiscover() {
 
     const String board_unique_id = "rolek_" + board_id;
     String friendly_hostname = hostname;
-    hostname[0] = hostname[0] ^ ' ';
+    friendly_hostname[0] = friendly_hostname[0] ^ ' ';
 
     for (const auto & kv : shutters) {
-        const auto unique_id = board_unique_id + "_" + String(kv.second.index);
-        const auto name = kv.first;
-        const String topic = hass_autodiscovery_topic + "/cover/" + unique_id + "/config";
-
-        JsonDocument json;
-        json["unique_id"] = unique_id;
-        json["name"] = friendly_hostname + " " + name;
-        json["object_id"] = hostname + "_" + name;
-        json["command_topic"] = "rolek/" + board_id + "/" + String(kv.second.index) + "/command";
-        json["state_topic"] = "rolek/" + board_id + "/" + String(kv.second.index) + "/state";
-        json["position_topic"] = "rolek/" + board_id + "/" + String(kv.second.index) + "/position";
-        json["set_position_topic"] = "rolek/" + board_id + "/" + String(kv.second.index) + "/position/set";
-        json["availability_topic"] = "rolek/" + board_id + "/availability";
-        json["device_class"] = "shutter";
-
-        auto device = json["device"];
-        device["name"] = "Rolek controller " + name;
-        device["suggested_area"] = get_first_word(name);
-        device["identifiers"][0] = unique_id;
-        device["via_device"] = board_unique_id;
-
-        auto publish = mqtt.begin_publish(topic, measureJson(json), 0, true);
-        serializeJson(json, publish);
-        publish.send();
+        announce(kv.first, kv.second);
     }
 
     struct Button {
@@ -120,6 +152,7 @@ void autodiscover() {
         {"down", "Close all shutters", "DOWN", "mdi:arrow-down-bold" },
         {"stop", "Stop all shutters", "STOP", "mdi:stop"},
         {"sync_position", "Sync position", "SYNC", "mdi:cog-sync" },
+        {"reload_config", "Reload configuration", "RELOAD", "mdi:file-refresh" },
     };
 
     for (const auto & button : buttons) {
@@ -188,9 +221,13 @@ void init() {
 
     mqtt.subscribe("rolek/" + board_id + "/command", [](const char * payload) {
         if (strcmp(payload, "RESET") == 0) {
+            // takes 6 seconds by design, it's not a stall
+            Watchdog::excuse();
             remote.reset();
         } else if (strcmp(payload, "SYNC") == 0) {
-            sync();
+            sync(false);
+        } else if (strcmp(payload, "RELOAD") == 0) {
+            reload_shutters();
         } else if (strcmp(payload, "STOP") == 0) {
             process("", COMMAND_STOP);
         } else if (strcmp(payload, "UP") == 0) {
@@ -208,36 +245,84 @@ void init() {
     mqtt.will.retain = true;
 
     mqtt.connected_callback = [] {
-        // send autodiscovery messages
-        autodiscover();
+        // clean up after shutters removed while disconnected, unless their index got reused in the meantime
+        for (const auto index : pending_retractions) {
+            if (std::none_of(shutters.begin(), shutters.end(), [index](const std::pair<const String, Shutter> & kv) {
+                return kv.second.index == index;
+            })) {
+                retract(index);
+            }
+        }
+        pending_retractions.clear();
+
+        // send autodiscovery messages, unless the watchdog asks to keep the loop short
+        if (Watchdog::shedding()) {
+            syslog.println("Home Assistant autodiscovery deferred.");
+            autodiscovery_pending = true;
+        } else {
+            autodiscover();
+        }
 
         // notify about the state of shutters
-        for (auto & watch : position_watches) { watch.fire(); }
-        for (auto & watch : state_watches) { watch.fire(); }
+        for (auto & kv : position_watches) { kv.second.fire(); }
+        for (auto & kv : state_watches) { kv.second.fire(); }
 
         // notify about availability
         mqtt.publish(mqtt.will.topic, "online", 0, true);
     };
 
     for (const auto & kv : shutters) {
-        const auto & shutter = kv.second;
-        position_watches.push_back(PicoUtils::Watch<double>(
-        [&shutter] {
-            const auto position = shutter.get_position();
-            return std::isnan(position) ? 50 : position;
-        },
-        [&shutter] { notify_position(shutter); }));
-        state_watches.push_back(PicoUtils::Watch<command_t>([&shutter] { return shutter.get_state(); },
-                                [&shutter] { notify_state(shutter); }));
+        add(kv.first, kv.second);
+    }
+}
+
+void watch(const String & name, const Shutter & shutter) {
+    position_watches.emplace(name, PicoUtils::Watch<double>(
+    [&shutter] {
+        const auto position = shutter.get_position();
+        return std::isnan(position) ? 50 : position;
+    },
+    [&shutter] { notify_position(shutter); }));
+    state_watches.emplace(name, PicoUtils::Watch<command_t>([&shutter] { return shutter.get_state(); },
+                          [&shutter] { notify_state(shutter); }));
+}
+
+void unwatch(const String & name) {
+    position_watches.erase(name);
+    state_watches.erase(name);
+}
+
+void add(const String & name, const Shutter & shutter) {
+    watch(name, shutter);
+
+    if (mqtt.connected()) {
+        announce(name, shutter);
+        notify_position(shutter);
+        notify_state(shutter);
+    }
+}
+
+void remove(const String & name, const Shutter & shutter) {
+    unwatch(name);
+
+    if (mqtt.connected()) {
+        retract(shutter.index);
+    } else {
+        pending_retractions.insert(shutter.index);
     }
 }
 
 void tick() {
     static PicoUtils::Stopwatch stopwatch;
 
+    if (autodiscovery_pending && mqtt.connected() && !Watchdog::shedding()) {
+        autodiscovery_pending = false;
+        autodiscover();
+    }
+
     if (stopwatch.elapsed_millis() >= 1000) {
-        for (auto & watch : position_watches) { watch.tick(); }
-        for (auto & watch : state_watches) { watch.tick(); }
+        for (auto & kv : position_watches) { kv.second.tick(); }
+        for (auto & kv : state_watches) { kv.second.tick(); }
         stopwatch.reset();
     }
 }
@@ -2,11 +2,19 @@
 
 #include <PicoMQTT.h>
 
-#include "remote.h"
+#include "shutter.h"
 
 namespace HomeAssistant {
 
 void init();
 void tick();
 
+// start and stop tracking shutters added or removed after init()
+void add(const String & name, const Shutter & shutter);
+void remove(const String & name, const Shutter & shutter);
+
+// only start or stop tracking state changes, without touching the autodiscovery entry
+void watch(const String & name, const Shutter & shutter);
+void unwatch(const String & name);
+
 }
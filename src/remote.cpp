@@ -1,5 +1,7 @@
 #include <Arduino.h>
 
+#include <time.h>
+
 #include <PicoSyslog.h>
 #include <PicoUtils.h>
 
@@ -15,10 +17,26 @@
 
 #define DEFAULT_INDEX 1
 
+// time without commands after which the cursor starts moving to the predicted index
+#define IDLE_TIME_MS 10000
+
+// minimum number of commands recorded at the current hour to base the prediction on it
+#define MIN_HOURLY_SAMPLES 3
+
 extern PicoSyslog::Logger syslog;
 
 namespace {
 
+// current hour of day or -1 if the clock isn't set
+int current_hour() {
+    const time_t now = time(nullptr);
+    if (now < 1000000000) {
+        // not synchronized with NTP yet
+        return -1;
+    }
+    return gmtime(&now)->tm_hour;
+}
+
 PicoUtils::PinOutput active_led(D3, true);
 PicoUtils::Blink blink(active_led, 0b10, 10);
 
@@ -104,17 +122,13 @@ void Remote::push(button_t button, unsigned long time) {
     active_led.set(false);
 }
 
-void Remote::navigate_to(unsigned int index) {
-    syslog.printf("Going from index %u to index %u\n", current_index, index);
-
-    while (current_index != index) {
-        if (current_index < index) {
-            push(BUTTON_RIGHT, 100);
-            current_index++;
-        } else {
-            push(BUTTON_LEFT, 100);
-            current_index--;
-        }
+void Remote::step_towards(unsigned int index) {
+    if (current_index < index) {
+        push(BUTTON_RIGHT, 100);
+        current_index++;
+    } else if (current_index > index) {
+        push(BUTTON_LEFT, 100);
+        current_index--;
     }
 }
 
@@ -137,6 +151,141 @@ void Remote::execute_command(const command_t command) {
 }
 
 void Remote::execute(unsigned int index, const command_t command) {
-    navigate_to(index);
-    execute_command(command);
+    record(index);
+
+    if (command == COMMAND_STOP) {
+        // A stop cancels any movement still waiting in the queue for the same shutter.  Index 0 controls all
+        // shutters, so stopping it cancels all queued movement.
+        jobs.remove_if([index](const Job & job) {
+            return ((index == 0) || (job.index == index)) && (job.command != COMMAND_STOP);
+        });
+
+        auto it = jobs.begin();
+        while (it != jobs.end() && it->command == COMMAND_STOP) {
+            if (it->index == index) {
+                // already queued
+                return;
+            }
+            ++it;
+        }
+
+        jobs.insert(it, Job{index, command});
+    } else {
+        // a newer movement command replaces a queued one for the same shutter
+        for (auto & job : jobs) {
+            if (job.index == index && job.command != COMMAND_STOP) {
+                job.command = command;
+                return;
+            }
+        }
+
+        jobs.push_back(Job{index, command});
+    }
+}
+
+void Remote::shed() {
+    jobs.remove_if([](const Job & job) { return job.command != COMMAND_STOP; });
+}
+
+void Remote::cancel(unsigned int index) {
+    jobs.remove_if([index](const Job & job) { return (job.index == index) && (job.command != COMMAND_STOP); });
+}
+
+bool Remote::pending(unsigned int index) const {
+    for (const auto & job : jobs) {
+        if (job.index == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Remote::record(unsigned int index) {
+    const int hour = current_hour();
+    if ((hour < 0) || (index > MAX_INDEX)) {
+        return;
+    }
+
+    auto & counts = history[hour];
+    if (counts[index] == 255) {
+        // halve all counts at this hour, so that old habits fade away
+        for (auto & count : counts) {
+            count /= 2;
+        }
+    }
+    ++counts[index];
+}
+
+unsigned int Remote::predict() const {
+    unsigned int counts[MAX_INDEX + 1] = {};
+    unsigned int total = 0;
+
+    const int hour = current_hour();
+    if (hour >= 0) {
+        for (unsigned int i = 0; i <= MAX_INDEX; ++i) {
+            counts[i] = history[hour][i];
+            total += counts[i];
+        }
+
+        if (total < MIN_HOURLY_SAMPLES) {
+            // not enough data for this hour, use the whole day
+            total = 0;
+            for (unsigned int i = 0; i <= MAX_INDEX; ++i) {
+                counts[i] = 0;
+                for (const auto & hourly : history) {
+                    counts[i] += hourly[i];
+                }
+                total += counts[i];
+            }
+        }
+    }
+
+    if (!total) {
+        return fallback_index;
+    }
+
+    // The weighted median minimizes the expected number of button presses needed to reach the next index.
+    unsigned int sum = 0;
+    for (unsigned int i = 0; i <= MAX_INDEX; ++i) {
+        sum += counts[i];
+        if (2 * sum >= total) {
+            return i;
+        }
+    }
+
+    return fallback_index;
+}
+
+void Remote::tick() {
+    if (jobs.empty()) {
+        if (predictive_navigation && (idle.elapsed_millis() >= IDLE_TIME_MS) && (!may_navigate || may_navigate())) {
+            // Move a single step per call, a real command queued in the meantime takes over immediately.
+            const unsigned int index = predict();
+            if (current_index != index) {
+                syslog.printf("Idle, moving cursor from index %u towards predicted index %u\n", current_index, index);
+                step_towards(index);
+            }
+        }
+        return;
+    }
+
+    idle.reset();
+
+    // Only a single button is pressed per call, so that new commands (especially STOP) get a chance to be queued in
+    // between.  The front of the queue is examined again each time, so navigation is always planned from the
+    // current index.
+    const Job job = jobs.front();
+
+    if (current_index != job.index) {
+        syslog.printf("Going from index %u towards index %u\n", current_index, job.index);
+        step_towards(job.index);
+        return;
+    }
+
+    jobs.pop_front();
+    execute_command(job.command);
+
+    if (on_execute) {
+        on_execute(job.index, job.command);
+    }
 }
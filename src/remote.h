@@ -1,5 +1,10 @@
 #pragma once
 
+#include <functional>
+#include <list>
+
+#include <PicoUtils.h>
+
 enum command_t { COMMAND_DOWN = 'd', COMMAND_UP = 'u', COMMAND_STOP = 's' };
 enum button_t { BUTTON_DOWN, BUTTON_UP, BUTTON_LEFT, BUTTON_RIGHT, BUTTON_STOP };
 
@@ -7,12 +12,50 @@ class Remote {
     public:
         void init();
         void reset();
+        void tick();
+
+        // Queue a command, it will be sent by tick() one button press at a time.  STOP commands are put in front of
+        // the queue, so that they never have to wait for more than a single button press.
         void execute(unsigned int index, const command_t command);
+        bool pending(unsigned int index) const;
+        bool busy() const { return !jobs.empty(); }
+
+        // drop all queued commands except STOP
+        void shed();
+
+        // drop queued commands for the given index except STOP
+        void cancel(unsigned int index);
+
+        // Called after a queued command has actually been sent
+        std::function<void(unsigned int index, command_t command)> on_execute;
+
+        // When idle, move the cursor towards the index most likely to be used next, based on the history of commands
+        // at the current hour of day.  Without any history, fallback_index is used.
+        bool predictive_navigation = true;
+        unsigned int fallback_index = 1;
+
+        // Idle navigation only happens while this returns true (or if it's not set), e.g. it must not move the cursor
+        // away from a shutter which will need a STOP soon.
+        std::function<bool()> may_navigate;
+
+        static const unsigned int MAX_INDEX = 15;
 
     protected:
+        struct Job {
+            unsigned int index;
+            command_t command;
+        };
+
         void push(button_t button, unsigned long time);
-        void navigate_to(unsigned int index);
+        void step_towards(unsigned int index);
         void execute_command(const command_t command);
 
+        void record(unsigned int index);
+        unsigned int predict() const;
+
+        std::list<Job> jobs;
         unsigned int current_index;
+
+        PicoUtils::Stopwatch idle;
+        uint8_t history[24][MAX_INDEX + 1] = {};
 };
@@ -1,7 +1,8 @@
+#include <algorithm>
 #include <map>
+#include <set>
 
 #include <ESP8266WebServer.h>
-#include <uri/UriRegex.h>
 #include <LittleFS.h>
 
 #include <ArduinoOTA.h>
@@ -10,9 +11,12 @@
 #include <PicoMQTT.h>
 #include <PicoSyslog.h>
 
+#include "config.h"
 #include "remote.h"
+#include "router.h"
 #include "shutter.h"
 #include "hass.h"
+#include "watchdog.h"
 
 String hostname;
 String hass_autodiscovery_topic;
@@ -25,6 +29,7 @@ Remote remote;
 
 std::map<String, Shutter> shutters;
 std::map<String, std::vector<String>> groups;
+ShutterIndex shutter_index;
 
 PicoUtils::PinOutput wifi_led(D4, true);
 
@@ -32,109 +37,237 @@ PicoUtils::WiFiControlSmartConfig wifi_control(wifi_led);
 
 PicoUtils::RestfulServer<ESP8266WebServer> server;
 
-bool process(const String & name, const command_t command) {
-    if (name.isEmpty()) {
+// file holding shutter positions across a planned reboot
+const char POSITIONS_FILE[] = "/positions.json";
+
+// set while an OTA upload is in progress, loop() doesn't run in the meantime
+bool ota_in_progress = false;
+
+void process(const ShutterIndex::Entry * target, const command_t command) {
+    if (!target) {
+        // A global command overrides any positioning in progress.  This is done when queuing, not when sending, so
+        // that positions set while the command waits in the queue are kept.
+        for (auto & kv : shutters) { kv.second.cancel_positioning(); }
         remote.execute(0, command);
+        return;
+    }
 
-        // notify individual shutters manually about the globally executed command
-        for (auto & kv : shutters) { kv.second.on_execute(command); }
+    for (auto * shutter : target->shutters) { shutter->process(command); }
+}
 
+bool process(const String & name, const command_t command) {
+    if (name.isEmpty()) {
+        process(nullptr, command);
         return true;
     }
 
-    {
-        const auto it = shutters.find(name);
-        if (it != shutters.end()) {
-            it->second.process(command);
-            return true;
-        }
+    const auto * target = shutter_index.find(name.c_str(), name.length());
+    if (!target) {
+        return false;
     }
 
-    {
-        const auto it = groups.find(name);
-        if (it != groups.end()) {
-            const auto & group = it->second;
-            for (const auto & element : group) {
-                process(element, command);
-            }
-            return true;
-        }
-    }
-
-    return false;
+    process(target, command);
+    return true;
 }
 
-bool set_position(const String & name, const double position) {
-    if (name.isEmpty()) {
+void set_position(const ShutterIndex::Entry * target, const double position) {
+    if (!target) {
         for (auto & kv : shutters) { kv.second.set_position(position); }
-        return true;
+        return;
     }
 
-    {
-        const auto it = shutters.find(name);
-        if (it != shutters.end()) {
-            it->second.set_position(position);
-            return true;
+    for (auto * shutter : target->shutters) { shutter->set_position(position); }
+}
+
+void sync(bool force) {
+    for (auto & kv : shutters) {
+        if (force || kv.second.needs_resync()) {
+            kv.second.sync();
         }
     }
+}
 
-    {
-        const auto it = groups.find(name);
-        if (it != groups.end()) {
-            const auto & group = it->second;
-            for (const auto & element : group) {
-                set_position(element, position);
-            }
-            return true;
-        }
+void update_fallback_index() {
+    // without any history, the median index minimizes the expected number of presses needed to reach a shutter
+    std::vector<unsigned int> indices;
+    for (const auto & kv : shutters) {
+        indices.push_back(kv.second.index);
     }
 
-    return false;
+    if (!indices.empty()) {
+        std::sort(indices.begin(), indices.end());
+        remote.fallback_index = indices[indices.size() / 2];
+    }
 }
 
-void sync() {
-    for (auto & kv : shutters) { kv.second.sync(); }
-}
+bool reload_shutters() {
+    syslog.println(F("Reloading shutter configuration..."));
 
-void setup_endpoints() {
-    server.on(UriRegex("/shutters(.*)/(up|down|stop)"), HTTP_POST, [] {
+    std::map<String, Shutter> new_shutters;
+    std::map<String, std::vector<String>> new_groups;
+    Config::load_shutters(LittleFS, new_shutters, new_groups);
+
+    if (Config::shutters_report.error.length()) {
+        syslog.println(F("Configuration invalid, keeping current one."));
+        return false;
+    }
 
-        syslog.printf("POST %s\n", server.uri().c_str());
+    unsigned int unchanged = 0;
+    unsigned int updated = 0;
+    unsigned int removed = 0;
 
-        String name = server.decodedPathArg(0);
-        const char direction = server.decodedPathArg(1).c_str()[0];
+    // Shutters are matched by index, which identifies the physical shutter.  Changed shutters get the tracked state of
+    // their predecessor and keep their autodiscovery entry (its unique_id is based on the index too).  The value tells
+    // if the shutter got renamed, in which case the entry needs an update.
+    std::map<String, bool> replacements;
+    std::set<String> kept;
 
-        if (name.length()) {
-            // name must start with slash if present
-            if (name[0] != '/') {
-                server.send(404);
-                return;
+    std::set<unsigned int> new_indices;
+    for (const auto & kv : new_shutters) {
+        new_indices.insert(kv.second.index);
+    }
+
+    // find an unclaimed new shutter with the same index, optionally also with the same name
+    const auto find_replacement = [&](const String & name, const Shutter & shutter, bool same_name) {
+        for (auto it = new_shutters.begin(); it != new_shutters.end(); ++it) {
+            if ((it->second.index == shutter.index) && (!same_name || (it->first == name))
+                    && !replacements.count(it->first)) {
+                return it;
             }
-            name = name.substring(1);
         }
+        return new_shutters.end();
+    };
 
-        const bool success = process(name.c_str(), command_t(direction));
-        server.send(success ? 200 : 404);
-    });
+    // first pass: shutters which kept their name and index
+    for (auto it = shutters.begin(); it != shutters.end();) {
+        const auto & shutter = it->second;
+        const auto replacement = find_replacement(it->first, shutter, true);
+
+        if (replacement == new_shutters.end()) {
+            ++it;
+        } else if ((replacement->second.open_time_ms == shutter.open_time_ms)
+                   && (replacement->second.close_time_ms == shutter.close_time_ms)) {
+            new_shutters.erase(replacement);
+            kept.insert(it->first);
+            ++unchanged;
+            ++it;
+        } else {
+            // only travel times changed
+            replacement->second.copy_state_from(shutter);
+            replacements[replacement->first] = false;
+            ++updated;
+            HomeAssistant::unwatch(it->first);
+            it = shutters.erase(it);
+        }
+    }
 
-    server.on(UriRegex("/shutters(.*)/set/([0-9]+)"), HTTP_POST, [] {
-        syslog.printf("POST %s\n", server.uri().c_str());
+    // second pass: renamed and removed shutters
+    for (auto it = shutters.begin(); it != shutters.end();) {
+        auto & shutter = it->second;
 
-        String name = server.decodedPathArg(0);
-        double position = server.decodedPathArg(1).toInt();
+        if (kept.count(it->first)) {
+            ++it;
+            continue;
+        }
 
-        if (name.length()) {
-            // name must start with slash if present
-            if (name[0] != '/') {
-                server.send(404);
-                return;
+        const auto replacement = find_replacement(it->first, shutter, false);
+        if (replacement != new_shutters.end()) {
+            replacement->second.copy_state_from(shutter);
+            replacements[replacement->first] = true;
+            ++updated;
+            HomeAssistant::unwatch(it->first);
+        } else if (new_indices.count(shutter.index)) {
+            // duplicate index, the physical shutter is still controlled by another entry
+            ++removed;
+            HomeAssistant::unwatch(it->first);
+        } else {
+            // commands sent after this point would not be tracked anymore
+            remote.cancel(shutter.index);
+            if (shutter.positioning()) {
+                // nothing would stop it at the set position anymore
+                syslog.printf("Stopping shutter %u, it was removed while positioning.\n", shutter.index);
+                shutter.process(COMMAND_STOP);
             }
-            name = name.substring(1);
+            ++removed;
+            HomeAssistant::remove(it->first, shutter);
         }
 
-        const bool success = set_position(name.c_str(), position);
-        server.send(success ? 200 : 404);
-    });
+        it = shutters.erase(it);
+    }
+
+    // anything left is new or a replacement
+    const unsigned int added = new_shutters.size() - updated;
+    while (!new_shutters.empty()) {
+        const auto it = shutters.insert(new_shutters.extract(new_shutters.begin())).position;
+        const auto replacement = replacements.find(it->first);
+        if ((replacement == replacements.end()) || replacement->second) {
+            // new or renamed, announcing a renamed shutter again updates the existing entity
+            HomeAssistant::add(it->first, it->second);
+        } else {
+            HomeAssistant::watch(it->first, it->second);
+        }
+    }
+
+    groups = std::move(new_groups);
+    shutter_index.build(shutters, groups);
+    update_fallback_index();
+
+    syslog.printf("Configuration reloaded: %u shutters unchanged, %u updated, %u removed, %u added.\n",
+                  unchanged, updated, removed, added);
+    return true;
+}
+
+void save_positions() {
+    JsonDocument json;
+    for (auto & kv : shutters) {
+        const auto & shutter = kv.second;
+        const double position = shutter.get_position();
+        if ((shutter.get_state() != COMMAND_STOP) || std::isnan(position)) {
+            // moving or unknown, the position won't be valid after reboot
+            continue;
+        }
+        auto entry = json[String(shutter.index)];
+        entry["position"] = position;
+        entry["uncertainty"] = shutter.get_uncertainty();
+    }
+
+    File file = LittleFS.open(POSITIONS_FILE, "w");
+    if (!file) {
+        syslog.println(F("Failed to save shutter positions."));
+        return;
+    }
+    serializeJson(json, file);
+    file.close();
+    syslog.println(F("Shutter positions saved."));
+}
+
+void restore_positions() {
+    if (!LittleFS.exists(POSITIONS_FILE)) {
+        return;
+    }
+
+    JsonDocument json;
+    {
+        File file = LittleFS.open(POSITIONS_FILE, "r");
+        deserializeJson(json, file);
+        file.close();
+    }
+
+    // The snapshot is only valid right after the reboot it was made for, shutters may be moved manually later.
+    LittleFS.remove(POSITIONS_FILE);
+
+    for (auto & kv : shutters) {
+        auto & shutter = kv.second;
+        const auto entry = json[String(shutter.index)];
+        if (entry.is<JsonObject>()) {
+            shutter.restore(entry["position"] | 50.0, entry["uncertainty"] | 0.0);
+            syslog.printf("Shutter %u position restored: %i\n", shutter.index, int(shutter.get_position()));
+        }
+    }
+}
+
+void setup_endpoints() {
+    server.addHandler(new ShutterRequestHandler());
 
     server.on("/shutters", [] {
         JsonDocument json;
@@ -152,47 +285,40 @@ void setup_endpoints() {
     });
 
     server.on("/reset", [] {
+        // takes 6 seconds by design, it's not a stall
+        Watchdog::excuse();
         remote.reset();
         server.send(200, F("text/plain"), F("OK"));
     });
 
     server.on("/sync", [] {
-        sync();
+        sync(server.hasArg("force"));
         server.send(200, F("text/plain"), F("OK"));
     });
 
-    server.serveStatic("/", LittleFS, "/ui/");
-}
+    server.on("/watchdog", [] {
+        JsonDocument json;
+        Watchdog::to_json(json.to<JsonObject>());
+        server.sendJson(json);
+    });
 
-void setup_shutters() {
-    PicoUtils::JsonConfigFile<JsonDocument> config(LittleFS, "/shutters.json");
+    server.on("/config/status", [] {
+        JsonDocument json;
+        Config::network_report.to_json(json["network"].to<JsonObject>());
+        Config::shutters_report.to_json(json["shutters"].to<JsonObject>());
+        server.sendJson(json);
+    });
 
-    for (const auto & kv : config.as<JsonObjectConst>()) {
-        const String key = kv.key().c_str();
-        if (kv.value().is<unsigned int>()) {
-            const unsigned int index = kv.value().as<unsigned int>();
-            if (index) {
-                shutters.emplace(key, index);
-            }
-        }
+    server.on("/config/reload", [] {
+        const bool success = reload_shutters();
 
-        if (kv.value().is<JsonObjectConst>()) {
-            const JsonObjectConst obj = kv.value().as<JsonObjectConst>();
-            const unsigned int index = obj["index"] | 0;
-            const double open_time = obj["open_time"] | obj["time"] | 30;
-            const double close_time = obj["close_time"] | obj["time"] | 30;
-            if (index) {
-                shutters.try_emplace(key, index, 1000 * open_time, 1000 * close_time);
-            }
-        }
+        JsonDocument json;
+        json["reloaded"] = success;
+        Config::shutters_report.to_json(json["shutters"].to<JsonObject>());
+        server.sendJson(json);
+    });
 
-        if (kv.value().is<JsonArrayConst>()) {
-            auto & group = groups[key];
-            for (const auto & element : kv.value().as<JsonArrayConst>()) {
-                group.push_back(element.as<String>());
-            }
-        }
-    }
+    server.serveStatic("/", LittleFS, "/ui/");
 }
 
 void setup() {
@@ -215,27 +341,28 @@ void setup() {
                      "https://github.com/mlesniew/rolek\n"
                      "\n"));
 
+    Watchdog::init();
+    Watchdog::on_shed = [] {
+        remote.shed();
+    };
+    Watchdog::on_reboot = [] {
+        save_positions();
+    };
+
     wifi_control.get_connectivity_level = [] {
         return mqtt.connected() ? 2 : 1;
     };
 
     Serial.println(F("Initializing file system..."));
     LittleFS.begin();
-    {
-        Serial.println(F("Load network configuration..."));
-        PicoUtils::JsonConfigFile<JsonDocument> config(LittleFS, F("/network.json"));
-        hostname = config["hostname"] | "rolek";
-        hass_autodiscovery_topic = config["hass_autodiscovery_topic"] | "homeassistant";
-        mqtt.host = config["mqtt"]["host"] | "";
-        mqtt.port = config["mqtt"]["port"] | 1883;
-        mqtt.username = config["mqtt"]["username"] | "mqtt";
-        mqtt.password = config["mqtt"]["password"] | "mosquitto";
-        password = config["password"] | "";
-        syslog.server = config["syslog"] | "";
-    }
+    Serial.println(F("Load network configuration..."));
+    Config::load_network(LittleFS);
 
     WiFi.hostname(hostname);
 
+    // the clock is only used to tell the hour of day for predictive navigation, so UTC is fine
+    configTime(0, 0, "pool.ntp.org");
+
     {
         PicoUtils::PinInput flash_button(D3, true);
         flash_button.init();
@@ -243,7 +370,30 @@ void setup() {
     }
 
     remote.init();
-    setup_shutters();
+    Config::load_shutters(LittleFS, shutters, groups);
+    restore_positions();
+    shutter_index.build(shutters, groups);
+    update_fallback_index();
+
+    remote.on_execute = [](unsigned int index, command_t command) {
+        // index 0 controls all shutters at once
+        for (auto & kv : shutters) {
+            if ((index == 0) || (kv.second.index == index)) {
+                kv.second.on_execute(command);
+            }
+        }
+    };
+
+    remote.may_navigate = [] {
+        if (ota_in_progress) {
+            // only commands needed to stop shutters are sent during uploads
+            return false;
+        }
+        // keep the cursor in place while shutters are moving, a STOP may be needed any moment
+        return std::none_of(shutters.begin(), shutters.end(), [](const std::pair<const String, Shutter> & kv) {
+            return kv.second.positioning() || (kv.second.get_state() != COMMAND_STOP);
+        });
+    };
 
     Serial.println(F("Setting up endpoints..."));
     setup_endpoints();
@@ -263,6 +413,53 @@ void setup() {
     if (password.length()) {
         ArduinoOTA.setPassword(password.c_str());
     }
+    ArduinoOTA.onStart([] {
+        Watchdog::excuse();
+        ota_in_progress = true;
+        if (ArduinoOTA.getCommand() == U_FS) {
+            // the filesystem image is about to be overwritten, positions can't be saved to it anymore
+            syslog.println(F("Filesystem upload started."));
+            LittleFS.end();
+        } else {
+            syslog.println(F("Firmware upload started."));
+        }
+    });
+    ArduinoOTA.onProgress([](unsigned int, unsigned int) {
+        // keep stopping shutters at their set positions while the upload is in progress
+        for (auto & kv : shutters) {
+            kv.second.tick();
+        }
+        remote.tick();
+    });
+    ArduinoOTA.onEnd([] {
+        syslog.println(F("Upload complete."));
+
+        // The chip restarts right after this returns.  Stop all moving shutters, so that they don't overshoot and
+        // their positions can be saved, and make sure the STOP commands are actually sent.
+        remote.shed();
+        for (auto & kv : shutters) {
+            auto & shutter = kv.second;
+            if (shutter.positioning() || (shutter.get_state() != COMMAND_STOP)) {
+                shutter.process(COMMAND_STOP);
+            }
+        }
+        while (remote.busy()) {
+            remote.tick();
+        }
+
+        ota_in_progress = false;
+        if (ArduinoOTA.getCommand() == U_FLASH) {
+            save_positions();
+        }
+    });
+    ArduinoOTA.onError([](ota_error_t error) {
+        ota_in_progress = false;
+        syslog.printf("Upload failed with error %u.\n", error);
+        if (ArduinoOTA.getCommand() == U_FS) {
+            // the old image is still there unless the upload got far enough to damage it
+            LittleFS.begin();
+        }
+    });
     ArduinoOTA.begin();
 
     Serial.println(F("Setup complete."));
@@ -274,18 +471,30 @@ void healthcheck() {
     if (WiFi.status() == WL_CONNECTED) {
         last_healthy.reset();
     } else if (last_healthy.elapsed_millis() >= 15 * 60 * 1000) {
-        syslog.println(F("Healthcheck failing for too long, resetting..."));
-        ESP.reset();
+        syslog.println(F("Healthcheck failing for too long, rebooting..."));
+        Watchdog::reboot();
     }
 };
 
 void loop() {
+    Watchdog::enter(Watchdog::STAGE_OTA);
     ArduinoOTA.handle();
+    Watchdog::enter(Watchdog::STAGE_SHUTTERS);
     for (auto & kv : shutters) {
         kv.second.tick();
     }
+    Watchdog::enter(Watchdog::STAGE_REMOTE);
+    remote.tick();
+    Watchdog::enter(Watchdog::STAGE_SERVER);
     server.handleClient();
+    Watchdog::enter(Watchdog::STAGE_MQTT);
     mqtt.loop();
+    Watchdog::enter(Watchdog::STAGE_HASS);
     HomeAssistant::tick();
+    Watchdog::enter(Watchdog::STAGE_WIFI);
     wifi_control.tick();
+    Watchdog::enter(Watchdog::STAGE_HEALTHCHECK);
+    healthcheck();
+    Watchdog::leave();
+    Watchdog::tick();
 }
@@ -0,0 +1,230 @@
+#include <Arduino.h>
+
+#include <algorithm>
+
+#include <PicoSyslog.h>
+
+#include "router.h"
+
+extern PicoSyslog::Logger syslog;
+
+void process(const ShutterIndex::Entry * target, const command_t command);
+void set_position(const ShutterIndex::Entry * target, const double position);
+
+namespace {
+
+// groups nested deeper than this are assumed to be circular
+const unsigned int MAX_GROUP_DEPTH = 8;
+
+struct Request {
+    const char * name;
+    size_t name_length;
+    bool set_position;
+    command_t command;
+    unsigned int position;
+};
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+// strcmp-like comparison of a (possibly url encoded) string with a null-terminated name
+int compare(const char * key, size_t length, bool url_encoded, const char * name) {
+    const char * const end = key + length;
+    while (key < end) {
+        unsigned char c = *key++;
+        if (url_encoded) {
+            if (c == '+') {
+                c = ' ';
+            } else if ((c == '%') && (end - key >= 2) && (hex_value(key[0]) >= 0) && (hex_value(key[1]) >= 0)) {
+                c = (hex_value(key[0]) << 4) | hex_value(key[1]);
+                key += 2;
+            }
+        }
+
+        const unsigned char n = *name;
+        if (n == '\0') {
+            // key is longer, even if c is a decoded %00
+            return 1;
+        }
+        if (c != n) {
+            return c < n ? -1 : 1;
+        }
+        ++name;
+    }
+    return *name ? -1 : 0;
+}
+
+bool parse(const String & uri, Request & request) {
+    static const char prefix[] = "/shutters";
+    static const size_t prefix_length = sizeof(prefix) - 1;
+
+    const char * begin = uri.c_str();
+    const char * end = begin + uri.length();
+
+    if ((size_t(end - begin) < prefix_length) || (memcmp(begin, prefix, prefix_length) != 0)) {
+        return false;
+    }
+    begin += prefix_length;
+
+    // the verb is the last path element
+    const char * verb = end;
+    while ((verb > begin) && (verb[-1] != '/')) {
+        --verb;
+    }
+
+    if (verb == begin) {
+        // no slash after prefix
+        return false;
+    }
+
+    const size_t verb_length = end - verb;
+    const char * name_end = verb - 1;
+
+    if ((verb_length == 2) && (memcmp(verb, "up", 2) == 0)) {
+        request.set_position = false;
+        request.command = COMMAND_UP;
+    } else if ((verb_length == 4) && (memcmp(verb, "down", 4) == 0)) {
+        request.set_position = false;
+        request.command = COMMAND_DOWN;
+    } else if ((verb_length == 4) && (memcmp(verb, "stop", 4) == 0)) {
+        request.set_position = false;
+        request.command = COMMAND_STOP;
+    } else if (verb_length > 0) {
+        unsigned int position = 0;
+        for (const char * c = verb; c < end; ++c) {
+            if (!isdigit(*c)) {
+                return false;
+            }
+            position = std::min(position * 10 + (*c - '0'), 1000u);
+        }
+
+        // preceded by /set
+        if ((name_end - begin < 4) || (memcmp(name_end - 4, "/set", 4) != 0)) {
+            return false;
+        }
+
+        name_end -= 4;
+        request.set_position = true;
+        request.position = position;
+    } else {
+        return false;
+    }
+
+    if (name_end > begin) {
+        // name must start with slash if present
+        if (*begin != '/') {
+            return false;
+        }
+        ++begin;
+    }
+
+    request.name = begin;
+    request.name_length = name_end - begin;
+    return true;
+}
+
+void collect(const String & name, std::map<String, Shutter> & shutters,
+             const std::map<String, std::vector<String>> & groups,
+             std::vector<Shutter *> & result, unsigned int depth = 0) {
+    {
+        const auto it = shutters.find(name);
+        if (it != shutters.end()) {
+            Shutter * shutter = &it->second;
+            if (std::find(result.begin(), result.end(), shutter) == result.end()) {
+                result.push_back(shutter);
+            }
+            return;
+        }
+    }
+
+    {
+        const auto it = groups.find(name);
+        if (it != groups.end()) {
+            if (depth >= MAX_GROUP_DEPTH) {
+                syslog.printf("Group %s nested too deep, circular reference?\n", name.c_str());
+                return;
+            }
+            for (const auto & element : it->second) {
+                collect(element, shutters, groups, result, depth + 1);
+            }
+        }
+    }
+}
+
+}
+
+void ShutterIndex::build(std::map<String, Shutter> & shutters, const std::map<String, std::vector<String>> & groups) {
+    entries.clear();
+    entries.reserve(shutters.size() + groups.size());
+
+    for (auto & kv : shutters) {
+        entries.push_back(Entry{kv.first.c_str(), {&kv.second}});
+    }
+
+    for (const auto & kv : groups) {
+        if (shutters.count(kv.first)) {
+            // shutters take precedence over groups with the same name
+            continue;
+        }
+        Entry entry{kv.first.c_str(), {}};
+        collect(kv.first, shutters, groups, entry.shutters);
+        entries.push_back(std::move(entry));
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+}
+
+const ShutterIndex::Entry * ShutterIndex::find(const char * name, size_t length, bool url_encoded) const {
+    size_t lo = 0;
+    size_t hi = entries.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const int result = compare(name, length, url_encoded, entries[mid].name);
+        if (result == 0) {
+            return &entries[mid];
+        } else if (result < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return nullptr;
+}
+
+bool ShutterRequestHandler::canHandle(HTTPMethod method, const String & uri) {
+    Request request;
+    return (method == HTTP_POST) && parse(uri, request);
+}
+
+bool ShutterRequestHandler::handle(ESP8266WebServer & server, HTTPMethod method, const String & uri) {
+    Request request;
+    if ((method != HTTP_POST) || !parse(uri, request)) {
+        return false;
+    }
+
+    syslog.printf("POST %s\n", uri.c_str());
+
+    const ShutterIndex::Entry * target = nullptr;
+    if (request.name_length) {
+        target = shutter_index.find(request.name, request.name_length, true);
+        if (!target) {
+            server.send(404);
+            return true;
+        }
+    }
+
+    if (request.set_position) {
+        set_position(target, request.position);
+    } else {
+        process(target, request.command);
+    }
+
+    server.send(200);
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <ESP8266WebServer.h>
+
+#include "shutter.h"
+
+// Sorted table of shutter and group names, groups are resolved to the shutters they contain in advance.  Lookups
+// don't allocate any memory.
+class ShutterIndex {
+    public:
+        struct Entry {
+            const char * name;
+            std::vector<Shutter *> shutters;
+        };
+
+        void build(std::map<String, Shutter> & shutters, const std::map<String, std::vector<String>> & groups);
+
+        // name doesn't have to be null-terminated, if url_encoded is set it's decoded on the fly
+        const Entry * find(const char * name, size_t length, bool url_encoded = false) const;
+
+    protected:
+        std::vector<Entry> entries;
+};
+
+extern ShutterIndex shutter_index;
+
+// Handles POST /shutters[/<name>]/(up|down|stop) and POST /shutters[/<name>]/set/<position> by parsing the URI in
+// place, without any heap allocations.
+class ShutterRequestHandler: public RequestHandler {
+    public:
+        bool canHandle(HTTPMethod method, const String & uri) override;
+        bool handle(ESP8266WebServer & server, HTTPMethod method, const String & uri) override;
+};
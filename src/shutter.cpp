@@ -3,10 +3,25 @@
 #include <PicoSyslog.h>
 
 #include "shutter.h"
-#include "hass.h"
 
 extern PicoSyslog::Logger syslog;
 
+namespace {
+
+// position error introduced by starting or stopping away from an end stop (start/stop lag, press timing)
+const double PRESS_UNCERTAINTY = 1.0;
+
+// position error introduced per percent of travel (inaccurate open/close times)
+const double TRAVEL_UNCERTAINTY = 0.02;
+
+}
+
+double Shutter::resync_threshold = 10;
+
+bool Shutter::needs_resync() const {
+    return std::isnan(position) || (uncertainty > resync_threshold);
+}
+
 void Shutter::set_position(double new_position) {
     if (new_position >= 100) {
         desired_position = std::numeric_limits<double>::quiet_NaN();
@@ -17,6 +32,14 @@ void Shutter::set_position(double new_position) {
     } else {
         desired_position = new_position;
 
+        if (!std::isnan(position) && needs_resync() && (desired_position > 50) == (desired_position > position)
+                && std::min(desired_position, 100 - desired_position) <= uncertainty) {
+            // We're moving towards the end stop closest to the target anyway and the target is within the error
+            // margin of that end stop.  Run all the way to the end stop to get an accurate position again.
+            syslog.printf("Shutter %i position uncertain (+/-%i), resyncing on the way...\n", index, int(uncertainty));
+            position = std::numeric_limits<double>::quiet_NaN();
+        }
+
         if (std::isnan(position)) {
             // position currently unknown
             syslog.printf("Shutter %i position unknown, %sing first...\n", index, desired_position > 50 ? "open" : "clos");
@@ -30,7 +53,7 @@ void Shutter::set_position(double new_position) {
 }
 
 void Shutter::sync() {
-    double new_desired_position = std::isnan(desired_position);
+    double new_desired_position = desired_position;
     process(COMMAND_STOP);
     if (std::isnan(new_desired_position)) {
         new_desired_position = std::isnan(position) ? 50.0 : double(position);
@@ -45,15 +68,33 @@ void Shutter::process(command_t command) {
 }
 
 void Shutter::execute(command_t command) {
+    // on_execute() gets called once the remote actually sends the command
     remote.execute(index, command);
-    on_execute(command);
 }
 
 void Shutter::on_execute(command_t command) {
     update_position_and_state();
+
+    if ((command != state) && (position > 0) && (position < 100)) {
+        // starting or stopping away from an end stop
+        uncertainty += PRESS_UNCERTAINTY;
+    }
+
     state = command;
 }
 
+void Shutter::copy_state_from(const Shutter & other) {
+    position = other.position;
+    state = other.state;
+    desired_position = other.desired_position;
+    uncertainty = other.uncertainty;
+}
+
+void Shutter::restore(double position, double uncertainty) {
+    this->position = position;
+    this->uncertainty = uncertainty;
+}
+
 void Shutter::update_position_and_state() {
     const unsigned long elapsed_millis = std::min(state.elapsed_millis(), position.elapsed_millis());
 
@@ -82,22 +123,33 @@ void Shutter::update_position_and_state() {
         if (elapsed_millis >= total_time_ms) {
             position = 50 + 50 * direction;
             state = COMMAND_STOP;
+            uncertainty = 0;
         }
     } else {
-        position = position + direction * (double(elapsed_millis) / double(open_time_ms) * 100);
+        const double delta = double(elapsed_millis) / double(total_time_ms) * 100;
+        position = position + direction * delta;
+        uncertainty += TRAVEL_UNCERTAINTY * delta;
         if (position >= 100) {
             position = 100;
             state = COMMAND_STOP;
+            uncertainty = 0;
         }
         if (position <= 0) {
             position = 0;
             state = COMMAND_STOP;
+            uncertainty = 0;
         }
     }
 }
 
 void Shutter::tick() {
     update_position_and_state();
+
+    if (remote.pending(index)) {
+        // state is about to change, wait for the queued command to be sent first
+        return;
+    }
+
     if (!std::isnan(position) && !std::isnan(desired_position)) {
 
         if (
@@ -13,7 +13,7 @@ class Shutter {
             : index(index),
               open_time_ms(open_time_ms), close_time_ms(close_time_ms),
               position(std::numeric_limits<double>::quiet_NaN()), state(COMMAND_STOP),
-              desired_position(std::numeric_limits<double>::quiet_NaN()) {
+              desired_position(std::numeric_limits<double>::quiet_NaN()), uncertainty(0) {
         }
 
         Shutter(unsigned int index, unsigned long open_close_time_ms = 30 * 1000)
@@ -28,8 +28,24 @@ class Shutter {
 
         void on_execute(command_t command);
 
+        // take over the tracked position and state of another instance controlling the same shutter
+        void copy_state_from(const Shutter & other);
+
         double get_position() const { return position; }
         command_t get_state() const { return state; }
+        double get_uncertainty() const { return uncertainty; }
+
+        // true while moving to a set position, i.e. tick() still has to stop the shutter at the right moment
+        bool positioning() const { return !std::isnan(desired_position); }
+        void cancel_positioning() { desired_position = std::numeric_limits<double>::quiet_NaN(); }
+
+        // restore a position saved before a reboot
+        void restore(double position, double uncertainty);
+
+        // true if position is unknown or may be off by more than resync_threshold
+        bool needs_resync() const;
+
+        static double resync_threshold;
 
         const unsigned int index;
         const unsigned long open_time_ms, close_time_ms;
@@ -42,6 +58,9 @@ class Shutter {
         PicoUtils::TimedValue<command_t> state;
 
         double desired_position;
+
+        // estimated error of position (in percent), accumulated since the last time an end stop was reached
+        double uncertainty;
 };
 
 extern std::map<std::string, Shutter> blinds;
@@ -0,0 +1,276 @@
+#include <Arduino.h>
+
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+#include <Ticker.h>
+
+#include "watchdog.h"
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+// The first 32 blocks of RTC user memory are used by the OTA updater
+const uint32_t RTC_STAGE_OFFSET = 64;
+const uint32_t RTC_RECORDS_OFFSET = 65;
+
+const uint32_t STAGE_MAGIC = 0x57440000;
+const uint32_t RECORDS_MAGIC = 0x57444f47;
+
+const size_t MAX_RECORDS = 8;
+
+// duration of stages which never finished, because the chip was reset
+const uint32_t DURATION_UNFINISHED = 0xffffffff;
+
+// number of recent stalls at which work gets shed and the chip gets rebooted
+const unsigned int SHED_STRIKES = 2;
+const unsigned int REBOOT_STRIKES = 5;
+
+// one strike is forgotten after this much time without stalls
+const unsigned long STRIKE_DECAY_MS = 60 * 1000;
+
+// A stage which doesn't return within this many budgets is considered wedged.  It's detected asynchronously, so this
+// also works if the stage keeps yielding and the hardware watchdog never fires.
+const unsigned long HARD_LIMIT_BUDGETS = 4;
+const unsigned long HARD_LIMIT_CHECK_MS = 1000;
+
+const char * const stage_names[] = {
+    "none", "ota", "shutters", "remote", "server", "mqtt", "hass", "wifi", "healthcheck",
+};
+
+struct Record {
+    uint32_t boot;
+    uint32_t stage;
+    uint32_t duration_ms;
+    uint32_t uptime_ms;
+};
+
+struct Records {
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t boot;
+    uint32_t next;
+    Record records[MAX_RECORDS];
+};
+
+static_assert(sizeof(Records) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+
+Records records;
+
+Watchdog::stage_t current_stage = Watchdog::STAGE_NONE;
+unsigned long stage_start;
+bool excused;
+
+unsigned int strikes;
+PicoUtils::Stopwatch last_stall;
+
+Ticker hard_limit_ticker;
+
+uint32_t crc32(const uint8_t * data, size_t length) {
+    uint32_t crc = 0xffffffff;
+    while (length--) {
+        crc ^= *data++;
+        for (unsigned int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+uint32_t records_crc() {
+    const size_t offset = offsetof(Records, boot);
+    return crc32(reinterpret_cast<const uint8_t *>(&records) + offset, sizeof(records) - offset);
+}
+
+void save_records() {
+    records.magic = RECORDS_MAGIC;
+    records.crc = records_crc();
+    ESP.rtcUserMemoryWrite(RTC_RECORDS_OFFSET, reinterpret_cast<uint32_t *>(&records), sizeof(records));
+}
+
+void save_stage(Watchdog::stage_t stage) {
+    uint32_t value = STAGE_MAGIC | stage;
+    ESP.rtcUserMemoryWrite(RTC_STAGE_OFFSET, &value, sizeof(value));
+}
+
+const char * stage_name(uint32_t stage) {
+    return stage < sizeof(stage_names) / sizeof(stage_names[0]) ? stage_names[stage] : "?";
+}
+
+void add_record(uint32_t stage, uint32_t duration_ms) {
+    Record & record = records.records[records.next];
+    record.boot = records.boot;
+    record.stage = stage;
+    record.duration_ms = duration_ms;
+    record.uptime_ms = millis();
+    records.next = (records.next + 1) % MAX_RECORDS;
+    save_records();
+}
+
+// Called from the timer, while loop() is stuck somewhere in a yield().  Only RTC memory is touched here, positions
+// can't be saved safely from this context.
+void check_hard_limit() {
+    if ((current_stage == Watchdog::STAGE_NONE) || excused) {
+        return;
+    }
+
+    const unsigned long duration_ms = millis() - stage_start;
+    if (duration_ms <= HARD_LIMIT_BUDGETS * Watchdog::budget_ms) {
+        return;
+    }
+
+    add_record(current_stage, duration_ms);
+    save_stage(Watchdog::STAGE_NONE);
+    ESP.reset();
+}
+
+void stall(Watchdog::stage_t stage, unsigned long duration_ms) {
+    add_record(stage, duration_ms);
+    ++strikes;
+    last_stall.reset();
+
+    syslog.printf("Watchdog: stage %s took %lu ms (budget %lu ms), %u recent stalls.\n",
+                  stage_name(stage), duration_ms, Watchdog::budget_ms, strikes);
+
+    if (strikes >= REBOOT_STRIKES) {
+        syslog.println(F("Watchdog: too many stalls, rebooting..."));
+        Watchdog::reboot();
+    } else if (strikes == SHED_STRIKES) {
+        syslog.println(F("Watchdog: shedding work."));
+        if (Watchdog::on_shed) {
+            Watchdog::on_shed();
+        }
+    }
+}
+
+}
+
+namespace Watchdog {
+
+unsigned long budget_ms = 5000;
+
+std::function<void()> on_shed;
+std::function<void()> on_reboot;
+
+void init() {
+    ESP.rtcUserMemoryRead(RTC_RECORDS_OFFSET, reinterpret_cast<uint32_t *>(&records), sizeof(records));
+    if ((records.magic != RECORDS_MAGIC) || (records.crc != records_crc()) || (records.next >= MAX_RECORDS)) {
+        // power on or corrupted data
+        memset(&records, 0, sizeof(records));
+    }
+
+    ++records.boot;
+
+    uint32_t stage;
+    ESP.rtcUserMemoryRead(RTC_STAGE_OFFSET, &stage, sizeof(stage));
+
+    const auto reason = ESP.getResetInfoPtr()->reason;
+    const bool crashed = (reason == REASON_WDT_RST) || (reason == REASON_EXCEPTION_RST)
+                         || (reason == REASON_SOFT_WDT_RST);
+
+    if (crashed && ((stage & 0xffff0000) == STAGE_MAGIC) && ((stage & 0xffff) != STAGE_NONE)) {
+        // the previous boot got stuck in this stage until the chip was reset
+        Record & record = records.records[records.next];
+        record.boot = records.boot - 1;
+        record.stage = stage & 0xffff;
+        record.duration_ms = DURATION_UNFINISHED;
+        record.uptime_ms = 0;
+        records.next = (records.next + 1) % MAX_RECORDS;
+    }
+
+    save_records();
+    save_stage(STAGE_NONE);
+
+    hard_limit_ticker.attach_ms(HARD_LIMIT_CHECK_MS, check_hard_limit);
+
+    for (const auto & record : records.records) {
+        if (!record.boot) {
+            continue;
+        }
+        if (record.duration_ms == DURATION_UNFINISHED) {
+            syslog.printf("Watchdog record: boot %u, stage %s never finished\n",
+                          record.boot, stage_name(record.stage));
+        } else {
+            syslog.printf("Watchdog record: boot %u, stage %s took %u ms\n",
+                          record.boot, stage_name(record.stage), record.duration_ms);
+        }
+    }
+}
+
+void tick() {
+    if (strikes && (last_stall.elapsed_millis() >= STRIKE_DECAY_MS)) {
+        --strikes;
+        last_stall.reset();
+        if (strikes == SHED_STRIKES - 1) {
+            syslog.println(F("Watchdog: no more stalls, back to normal operation."));
+        }
+    }
+}
+
+void enter(stage_t stage) {
+    leave();
+    current_stage = stage;
+    stage_start = millis();
+    save_stage(stage);
+}
+
+void leave() {
+    if (current_stage == STAGE_NONE) {
+        return;
+    }
+
+    const stage_t stage = current_stage;
+    const unsigned long duration_ms = millis() - stage_start;
+    current_stage = STAGE_NONE;
+    save_stage(STAGE_NONE);
+
+    if (excused) {
+        excused = false;
+    } else if (duration_ms > budget_ms) {
+        stall(stage, duration_ms);
+    }
+}
+
+void excuse() {
+    excused = true;
+}
+
+bool shedding() {
+    return strikes >= SHED_STRIKES;
+}
+
+void reboot() {
+    if (on_reboot) {
+        on_reboot();
+    }
+    save_stage(STAGE_NONE);
+    ESP.restart();
+}
+
+void to_json(JsonObject json) {
+    json["budget_ms"] = budget_ms;
+    json["hard_limit_ms"] = HARD_LIMIT_BUDGETS * budget_ms;
+    json["boot"] = records.boot;
+    json["strikes"] = strikes;
+    json["shedding"] = shedding();
+
+    auto array = json["records"].to<JsonArray>();
+    // oldest first
+    for (size_t i = 0; i < MAX_RECORDS; ++i) {
+        const Record & record = records.records[(records.next + i) % MAX_RECORDS];
+        if (!record.boot) {
+            continue;
+        }
+        auto element = array.add<JsonObject>();
+        element["boot"] = record.boot;
+        element["stage"] = stage_name(record.stage);
+        if (record.duration_ms == DURATION_UNFINISHED) {
+            element["finished"] = false;
+        } else {
+            element["duration_ms"] = record.duration_ms;
+            element["uptime_ms"] = record.uptime_ms;
+        }
+    }
+}
+
+}
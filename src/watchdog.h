@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+
+#include <ArduinoJson.h>
+
+// Software watchdog for the stages of loop().  Stages taking longer than budget_ms are recorded in RTC memory, so the
+// records survive resets.  Repeated stalls first make the rest of the firmware shed work and eventually trigger a
+// controlled reboot.  A stage which doesn't return at all is recorded and reset from a timer.
+namespace Watchdog {
+
+enum stage_t {
+    STAGE_NONE,
+    STAGE_OTA,
+    STAGE_SHUTTERS,
+    STAGE_REMOTE,
+    STAGE_SERVER,
+    STAGE_MQTT,
+    STAGE_HASS,
+    STAGE_WIFI,
+    STAGE_HEALTHCHECK,
+};
+
+extern unsigned long budget_ms;
+
+// called when shedding starts and right before a controlled reboot
+extern std::function<void()> on_shed;
+extern std::function<void()> on_reboot;
+
+void init();
+void tick();
+
+// mark the start of a stage, this also ends the previous one
+void enter(stage_t stage);
+void leave();
+
+// the current stage is expected to take long this time (e.g. firmware upload), don't count it as a stall
+void excuse();
+
+bool shedding();
+
+// controlled reboot, calls on_reboot first
+void reboot();
+
+void to_json(JsonObject json);
+
+}